@@ -1,5 +1,12 @@
+#define _GNU_SOURCE             //copy_file_range, splice, memrchr, memfd_create
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <termios.h>            //termios, TCSANOW, ECHO, ICANON
@@ -7,6 +14,9 @@
 #include <stdbool.h>
 #include <errno.h>
 const char * sysname = "seashell";
+bool fastio_enabled = true; // run cat/cp/wc/head/tail in-process, see fastio command
+
+#define FASTIO_CHUNK (128*1024)
 
 enum return_codes {
     SUCCESS = 0,
@@ -141,6 +151,7 @@ int parse_command(char *buf, struct command_t *command)
         if (strcmp(arg, "|")==0)
         {
             struct command_t *c=malloc(sizeof(struct command_t));
+            memset(c, 0, sizeof(struct command_t)); // set all bytes to 0
             int l=strlen(pch);
             pch[l]=splitters[0]; // restore strtok termination
             index=1;
@@ -172,8 +183,15 @@ int parse_command(char *buf, struct command_t *command)
         }
         if (redirect_index != -1)
         {
-            command->redirects[redirect_index]=malloc(len);
-            strcpy(command->redirects[redirect_index], arg+1);
+            char *target=arg+1;
+            if (*target==0) // "cat f > g", target is the next token
+            {
+                pch = strtok(NULL, splitters);
+                if (pch) target=pch;
+            }
+            free(command->redirects[redirect_index]);
+            command->redirects[redirect_index]=malloc(strlen(target)+1);
+            strcpy(command->redirects[redirect_index], target);
             continue;
         }
 
@@ -197,6 +215,7 @@ void prompt_backspace()
     putchar(' '); // write empty over
     putchar(8); // go back 1 again
 }
+int parse_command_line(const char *buf, struct command_t *command);
 /**
  * Prompt a command from the user
  * @param  buf      [description]
@@ -291,12 +310,15 @@ int prompt(struct command_t *command)
 
       strcpy(oldbuf, buf);
 
-      parse_command(buf, command);
+    // restore the old settings before any $(...) gets to run
+    tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
 
-     //  print_command(command); // DEBUG: uncomment for debugging
+      if (buf[strspn(buf, " \t")]==0) // nothing to parse, as in capture_output
+          command->name=strdup("");
+      else
+          parse_command_line(buf, command);
 
-    // restore the old settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
+     //  print_command(command); // DEBUG: uncomment for debugging
       return SUCCESS;
 }
 int process_command(struct command_t *command);
@@ -386,6 +408,853 @@ int find_line_number(char* filename, char* text){
     return -1;
 }
 
+/**
+ * Opens the files named by the redirects of a command
+ * @param  command [description]
+ * @param  in_fd   set to the input fd, STDIN_FILENO if not redirected
+ * @param  out_fd  set to the output fd, STDOUT_FILENO if not redirected
+ * @return         0 on success, -1 if a file could not be opened
+ */
+int open_redirects(struct command_t *command, int *in_fd, int *out_fd)
+{
+    *in_fd=STDIN_FILENO;
+    *out_fd=STDOUT_FILENO;
+    for (int i=0;i<3;++i)
+        if (command->redirects[i] && command->redirects[i][0]==0)
+        {
+            fprintf(stderr, "-%s: %s: missing redirect target\n", sysname, command->name);
+            return -1;
+        }
+    if (command->redirects[0])
+    {
+        *in_fd=open(command->redirects[0], O_RDONLY);
+        if (*in_fd==-1)
+        {
+            fprintf(stderr, "-%s: %s: %s\n", sysname, command->redirects[0], strerror(errno));
+            return -1;
+        }
+    }
+    if (command->redirects[1] || command->redirects[2])
+    {
+        char *target=command->redirects[2]?command->redirects[2]:command->redirects[1];
+        int flags=O_WRONLY|O_CREAT|(command->redirects[2]?O_APPEND:O_TRUNC);
+        *out_fd=open(target, flags, 0644);
+        if (*out_fd==-1)
+        {
+            fprintf(stderr, "-%s: %s: %s\n", sysname, target, strerror(errno));
+            if (*in_fd!=STDIN_FILENO)
+                close(*in_fd);
+            return -1;
+        }
+    }
+    return 0;
+}
+void close_redirects(int in_fd, int out_fd)
+{
+    if (in_fd!=STDIN_FILENO)
+        close(in_fd);
+    if (out_fd!=STDOUT_FILENO)
+        close(out_fd);
+}
+/**
+ * Writes the whole buffer, retrying on short writes
+ * @return 0 on success, -1 on error
+ */
+int write_all(int fd, const char *buf, size_t len)
+{
+    while (len>0)
+    {
+        ssize_t n=write(fd, buf, len);
+        if (n==-1)
+        {
+            if (errno==EINTR) continue;
+            return -1;
+        }
+        buf+=n;
+        len-=n;
+    }
+    return 0;
+}
+/**
+ * Copies in_fd to out_fd from the current offsets until end of input.
+ * Tries the in-kernel transfers first so the data never enters our buffers:
+ * copy_file_range between regular files, sendfile from a regular file,
+ * splice when either end is a pipe. Each one falls through to the next
+ * when the kernel refuses the fd pair; offsets are advanced by the kernel,
+ * so a later method picks up where the previous one stopped.
+ * @return 0 on success, -1 on error (errno set)
+ */
+int copy_fd(int in_fd, int out_fd)
+{
+    struct stat in_st, out_st;
+    ssize_t n;
+    if (fstat(in_fd, &in_st)==-1 || fstat(out_fd, &out_st)==-1)
+        return -1;
+
+    // procfs/sysfs files report size 0 and copy_file_range/sendfile may
+    // return 0 for them right away, so those go through read/write
+    bool regular_in=S_ISREG(in_st.st_mode) && in_st.st_size>0;
+
+    if (regular_in && S_ISREG(out_st.st_mode))
+    {
+        while ((n=copy_file_range(in_fd, NULL, out_fd, NULL, FASTIO_CHUNK, 0))>0);
+        if (n==0) return 0;
+    }
+    if (regular_in)
+    {
+        while ((n=sendfile(out_fd, in_fd, NULL, FASTIO_CHUNK))>0);
+        if (n==0) return 0;
+    }
+    if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))
+    {
+        while ((n=splice(in_fd, NULL, out_fd, NULL, FASTIO_CHUNK, SPLICE_F_MOVE))>0);
+        if (n==0) return 0;
+    }
+
+    // ttys, sockets and anything the kernel would not transfer for us
+    char *buf=malloc(FASTIO_CHUNK);
+    while ((n=read(in_fd, buf, FASTIO_CHUNK))!=0)
+    {
+        if (n==-1)
+        {
+            if (errno==EINTR) continue;
+            break;
+        }
+        if (write_all(out_fd, buf, n)==-1)
+        {
+            n=-1;
+            break;
+        }
+    }
+    free(buf);
+    return n==0?0:-1;
+}
+/**
+ * Counts '\n' bytes 8 at a time: after xor with "\n\n\n\n\n\n\n\n" the
+ * newline bytes are zero, and the mask trick sets the high bit of exactly
+ * the zero bytes without carries between them.
+ * @return number of newlines in buf
+ */
+size_t count_newlines(const char *buf, size_t len)
+{
+    const uint64_t ones=0x0101010101010101ULL;
+    const uint64_t newlines=ones*'\n', low7=ones*0x7f;
+    size_t count=0, i=0;
+    for (;i+8<=len;i+=8)
+    {
+        uint64_t x;
+        memcpy(&x, buf+i, 8);
+        x^=newlines;
+        x=~(((x&low7)+low7)|x|low7);
+        count+=__builtin_popcountll(x);
+    }
+    for (;i<len;++i)
+        count+=buf[i]=='\n';
+    return count;
+}
+/**
+ * Parses the line count option of head/tail: -n N, -nN or -N
+ * @param  command [description]
+ * @param  lines   set to the line count, 10 if not given
+ * @return         index of the first file argument, -1 for options we
+ *                 do not handle (the external binary runs instead)
+ */
+int parse_line_count(struct command_t *command, long *lines)
+{
+    int i=0;
+    char *value=NULL, *end;
+    *lines=10;
+    if (command->arg_count>0 && command->args[0][0]=='-' && command->args[0][1])
+    {
+        if (strcmp(command->args[0], "-n")==0)
+        {
+            if (command->arg_count<2) return -1;
+            value=command->args[1];
+            i=2;
+        }
+        else
+        {
+            value=command->args[0]+(command->args[0][1]=='n'?2:1);
+            i=1;
+        }
+        // tail -n +N counts from the start, leave that to the real binary
+        if (*value=='+') return -1;
+        *lines=strtol(value, &end, 10);
+        if (*value==0 || *end!=0 || *lines<0) return -1;
+    }
+    for (int j=i;j<command->arg_count;++j)
+        if ((command->args[j][0]=='-' && command->args[j][1])
+            || (j==0 && command->args[j][0]=='+')) // obsolete tail +N
+            return -1;
+    return i;
+}
+/**
+ * Writes the first lines of in_fd to out_fd
+ * @return 0 on success, -1 on error
+ */
+int head_fd(int in_fd, int out_fd, long lines)
+{
+    char *buf=malloc(FASTIO_CHUNK);
+    ssize_t n=0;
+    while (lines>0 && (n=read(in_fd, buf, FASTIO_CHUNK))>0)
+    {
+        char *p=buf, *end=buf+n;
+        while (lines>0 && (p=memchr(p, '\n', end-p))!=NULL)
+        {
+            p++;
+            lines--;
+        }
+        if (p==NULL) p=end;
+        if (write_all(out_fd, buf, p-buf)==-1)
+        {
+            n=-1;
+            break;
+        }
+    }
+    free(buf);
+    return n==-1?-1:0;
+}
+struct tail_chunk_t {
+    char *buf;
+    size_t len;
+    size_t newlines;
+};
+/**
+ * Writes the last lines of in_fd to out_fd. Regular files are scanned
+ * backwards from the end and the tail is then copied with copy_fd;
+ * anything else is read forward, keeping only the recent chunks.
+ * @return 0 on success, -1 on error
+ */
+int tail_fd(int in_fd, int out_fd, long lines)
+{
+    struct stat st;
+    char *buf, last;
+    if (lines==0) return 0;
+
+    if (fstat(in_fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0)
+    {
+        off_t pos=st.st_size, start=0;
+        // a trailing newline ends the last line instead of starting a new one
+        long needed=lines;
+        if (pread(in_fd, &last, 1, pos-1)==1 && last=='\n')
+            needed++;
+
+        buf=malloc(FASTIO_CHUNK);
+        while (pos>0)
+        {
+            size_t len=pos>FASTIO_CHUNK?FASTIO_CHUNK:pos;
+            pos-=len;
+            if (pread(in_fd, buf, len, pos)!=(ssize_t)len)
+            {
+                free(buf);
+                return -1;
+            }
+            size_t count=count_newlines(buf, len);
+            if ((long)count<needed)
+            {
+                needed-=count;
+                continue;
+            }
+            // the first line to print starts inside this chunk
+            char *p=buf+len;
+            while (needed-->0)
+                p=memrchr(buf, '\n', p-buf);
+            start=pos+(p-buf)+1;
+            break;
+        }
+        free(buf);
+        if (lseek(in_fd, start, SEEK_SET)==-1)
+            return -1;
+        return copy_fd(in_fd, out_fd);
+    }
+
+    // streams: keep only the newest chunks that still hold lines+1 newlines
+    struct tail_chunk_t *chunks=NULL;
+    int count=0;
+    size_t kept_newlines=0;
+    ssize_t n=1;
+    while (n>0)
+    {
+        struct tail_chunk_t chunk={malloc(FASTIO_CHUNK), 0, 0};
+        while (chunk.len<FASTIO_CHUNK)
+        {
+            n=read(in_fd, chunk.buf+chunk.len, FASTIO_CHUNK-chunk.len);
+            if (n==-1 && errno==EINTR) continue;
+            if (n<=0) break;
+            chunk.len+=n;
+        }
+        if (chunk.len==0)
+        {
+            free(chunk.buf);
+            break;
+        }
+        chunk.newlines=count_newlines(chunk.buf, chunk.len);
+        chunks=realloc(chunks, sizeof(struct tail_chunk_t)*(count+1));
+        chunks[count++]=chunk;
+        kept_newlines+=chunk.newlines;
+        while (count>1 && kept_newlines-chunks[0].newlines>(size_t)lines)
+        {
+            kept_newlines-=chunks[0].newlines;
+            free(chunks[0].buf);
+            memmove(chunks, chunks+1, sizeof(struct tail_chunk_t)*--count);
+        }
+    }
+
+    int r=n==-1?-1:0, i=count-1;
+    char *p=count>0?chunks[0].buf:NULL;
+    long needed=lines;
+    if (count>0 && chunks[count-1].buf[chunks[count-1].len-1]=='\n')
+        needed++;
+    for (;r==0 && i>=0;--i)
+    {
+        if ((long)chunks[i].newlines<needed)
+        {
+            needed-=chunks[i].newlines;
+            continue;
+        }
+        // the first line to print starts inside this chunk
+        p=chunks[i].buf+chunks[i].len;
+        while (needed-->0)
+            p=memrchr(chunks[i].buf, '\n', p-chunks[i].buf);
+        p++;
+        break;
+    }
+    if (i<0) i=0;
+    for (int j=i;r==0 && j<count;++j)
+    {
+        char *from=j==i?p:chunks[j].buf;
+        r=write_all(out_fd, from, chunks[j].buf+chunks[j].len-from);
+    }
+    for (int j=0;j<count;++j)
+        free(chunks[j].buf);
+    free(chunks);
+    return r;
+}
+/**
+ * Runs cat, cp, wc, head and tail without forking. Only the plain forms
+ * are handled here; any option we do not know is left to the real binary.
+ * @param  command [description]
+ * @return         SUCCESS if handled, UNKNOWN to fall back to exec
+ */
+int process_fastio(struct command_t *command)
+{
+    int in_fd, out_fd, first=0, r=0;
+    long lines=0;
+    char *mode=NULL;
+
+    if (strcmp(command->name, "cat")==0)
+    {
+        for (int i=0;i<command->arg_count;++i)
+            if (command->args[i][0]=='-' && command->args[i][1])
+                return UNKNOWN;
+    }
+    else if (strcmp(command->name, "cp")==0)
+    {
+        if (command->arg_count!=2 || command->args[0][0]=='-' || command->args[1][0]=='-')
+            return UNKNOWN;
+        char target[PATH_MAX];
+        struct stat st;
+        int len=snprintf(target, sizeof(target), "%s", command->args[1]);
+        if (len<(int)sizeof(target) && stat(target, &st)==0 && S_ISDIR(st.st_mode))
+        {
+            char *base=strrchr(command->args[0], '/');
+            len=snprintf(target, sizeof(target), "%s/%s", command->args[1],
+                base?base+1:command->args[0]);
+        }
+        if (len>=(int)sizeof(target))
+        {
+            fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name, command->args[1], strerror(ENAMETOOLONG));
+            return SUCCESS;
+        }
+        in_fd=open(command->args[0], O_RDONLY);
+        if (in_fd==-1 || fstat(in_fd, &st)==-1)
+        {
+            fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name, command->args[0], strerror(errno));
+            if (in_fd!=-1) close(in_fd);
+            return SUCCESS;
+        }
+        if (S_ISDIR(st.st_mode)) // cp -r and friends are the real binary's job
+        {
+            close(in_fd);
+            return UNKNOWN;
+        }
+        // opening the target truncates it, so copying a file onto itself
+        // (or onto a hard link of itself) would lose the data
+        struct stat target_st;
+        if (stat(target, &target_st)==0 && target_st.st_dev==st.st_dev && target_st.st_ino==st.st_ino)
+        {
+            fprintf(stderr, "-%s: %s: '%s' and '%s' are the same file\n", sysname, command->name, command->args[0], target);
+            close(in_fd);
+            return SUCCESS;
+        }
+        out_fd=open(target, O_WRONLY|O_CREAT|O_TRUNC, st.st_mode&0777);
+        if (out_fd==-1)
+        {
+            fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name, target, strerror(errno));
+            close(in_fd);
+            return SUCCESS;
+        }
+        if (copy_fd(in_fd, out_fd)==-1)
+            fprintf(stderr, "-%s: %s: %s\n", sysname, command->name, strerror(errno));
+        close(in_fd);
+        close(out_fd);
+        return SUCCESS;
+    }
+    else if (strcmp(command->name, "wc")==0)
+    {
+        if (command->arg_count==0
+            || (strcmp(command->args[0], "-l")!=0 && strcmp(command->args[0], "-c")!=0))
+            return UNKNOWN;
+        for (int i=1;i<command->arg_count;++i)
+            if (command->args[i][0]=='-' && command->args[i][1])
+                return UNKNOWN;
+        mode=command->args[0];
+        first=1;
+    }
+    else if (strcmp(command->name, "head")==0 || strcmp(command->name, "tail")==0)
+    {
+        first=parse_line_count(command, &lines);
+        if (first==-1)
+            return UNKNOWN;
+    }
+    else return UNKNOWN;
+
+    if (open_redirects(command, &in_fd, &out_fd)==-1)
+        return SUCCESS;
+    fflush(stdout); // keep earlier printf output ahead of ours
+
+    long total=0;
+    int file_count=command->arg_count-first;
+    for (int i=first;i<command->arg_count || (i==first && file_count==0);++i)
+    {
+        char *name=i<command->arg_count?command->args[i]:NULL;
+        int fd=in_fd;
+        r=0;
+        if (name && strcmp(name, "-")!=0)
+        {
+            fd=open(name, O_RDONLY);
+            if (fd==-1)
+            {
+                fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name, name, strerror(errno));
+                continue;
+            }
+        }
+
+        if (command->name[0]=='c') // cat
+        {
+            // appending a file to itself would keep reading what it just wrote
+            struct stat in_st, out_st;
+            if (fstat(fd, &in_st)==0 && fstat(out_fd, &out_st)==0 && S_ISREG(in_st.st_mode)
+                && in_st.st_dev==out_st.st_dev && in_st.st_ino==out_st.st_ino)
+                fprintf(stderr, "-%s: %s: %s: input file is output file\n", sysname, command->name, name?name:"-");
+            else
+                r=copy_fd(fd, out_fd);
+        }
+        else if (command->name[0]=='w') // wc
+        {
+            struct stat st;
+            long count=0;
+            if (mode[1]=='c' && fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0)
+                count=st.st_size;
+            else
+            {
+                char *buf=malloc(FASTIO_CHUNK);
+                ssize_t n;
+                while ((n=read(fd, buf, FASTIO_CHUNK))>0)
+                    count+=mode[1]=='l'?(long)count_newlines(buf, n):n;
+                free(buf);
+                r=n==-1?-1:0;
+            }
+            total+=count;
+            if (r==0)
+                dprintf(out_fd, name?"%ld %s\n":"%ld\n", count, name);
+        }
+        else
+        {
+            if (file_count>1)
+                dprintf(out_fd, "%s==> %s <==\n", i==first?"":"\n", name);
+            r=command->name[0]=='h'?head_fd(fd, out_fd, lines):tail_fd(fd, out_fd, lines);
+        }
+        if (r==-1)
+            fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name, name?name:"-", strerror(errno));
+        if (fd!=in_fd)
+            close(fd);
+    }
+    if (mode && file_count>1)
+        dprintf(out_fd, "%ld total\n", total);
+
+    close_redirects(in_fd, out_fd);
+    return SUCCESS;
+}
+
+/**
+ * Replaces the current process with the command, never returns
+ * @param command [description]
+ */
+void exec_command(struct command_t *command)
+{
+    // same redirects as the in-process builtins get from open_redirects
+    int in_fd, out_fd;
+    if (open_redirects(command, &in_fd, &out_fd)==-1)
+        exit(1);
+    if ((in_fd!=STDIN_FILENO && dup2(in_fd, STDIN_FILENO)==-1)
+        || (out_fd!=STDOUT_FILENO && dup2(out_fd, STDOUT_FILENO)==-1))
+    {
+        fprintf(stderr, "-%s: %s: %s\n", sysname, command->name, strerror(errno));
+        exit(1);
+    }
+    close_redirects(in_fd, out_fd);
+
+    /// This shows how to do exec with environ (but is not available on MacOs)
+    // extern char** environ; // environment variables
+    // execvpe(command->name, command->args, environ); // exec+args+path+environ
+
+    /// This shows how to do exec with auto-path resolve
+    // add a NULL argument to the end of args, and the name to the beginning
+    // as required by exec
+    
+    // increase args size by 2
+    command->args=(char **)realloc(
+        command->args, sizeof(char *)*(command->arg_count+=2));
+
+    // shift everything forward by 1
+    for (int i=command->arg_count-2;i>0;--i)
+        command->args[i]=command->args[i-1];
+
+    // set args[0] as a copy of name
+    command->args[0]=strdup(command->name);
+    // set args[arg_count-1] (last) to NULL
+    command->args[command->arg_count-1]=NULL;
+    
+    //char *pathCom= getenv(command->name);
+    //printf("-%s:\n",command->name);
+
+    execvp(command->name, command->args); // exec+args+path
+    exit(0);
+    /// TODO: do your own exec with path resolving using execv()
+}
+
+const char *builtin_names[] = {"cd", "exit", "fastio", "highlight", "goodMorning",
+    "shortdir", "kdiff", NULL};
+const char *fastio_names[] = {"cat", "cp", "wc", "head", "tail", NULL};
+/**
+ * Tells whether process_command runs the command without forking
+ * @param  command [description]
+ * @return         true for builtins
+ */
+bool is_builtin(struct command_t *command)
+{
+    for (int i=0;builtin_names[i];++i)
+        if (strcmp(command->name, builtin_names[i])==0)
+            return true;
+    if (fastio_enabled && !command->background)
+        for (int i=0;fastio_names[i];++i)
+            if (strcmp(command->name, fastio_names[i])==0)
+                return true;
+    return false;
+}
+/**
+ * Reads fd until end of file into a growable buffer
+ * @param  fd   [description]
+ * @param  size initial buffer size, grown by doubling
+ * @return      malloc'd, null terminated contents
+ */
+char *read_fd(int fd, size_t size)
+{
+    size_t len=0;
+    ssize_t n;
+    char *buf=malloc(size+1);
+    // always leave a full chunk free so every read can take a large bite
+    while (1)
+    {
+        if (size-len<FASTIO_CHUNK)
+            buf=realloc(buf, (size=size*2+FASTIO_CHUNK)+1);
+        n=read(fd, buf+len, size-len);
+        if (n==-1 && errno==EINTR) continue;
+        if (n<=0) break;
+        len+=n;
+    }
+    buf[len]=0;
+    return buf;
+}
+/**
+ * Runs a builtin in this process with stdout pointed at a memfd
+ * @param  command [description]
+ * @return         malloc'd output, NULL if it could not be captured
+ */
+char *capture_builtin(struct command_t *command)
+{
+    int fd=-1, saved_stdout=-1, cwd_fd=-1;
+    char *output=NULL;
+    struct stat st;
+
+    fflush(stdout);
+    if ((fd=memfd_create("seashell-capture", MFD_CLOEXEC))==-1
+        || (saved_stdout=dup(STDOUT_FILENO))==-1
+        || (cwd_fd=open(".", O_RDONLY|O_DIRECTORY))==-1
+        || dup2(fd, STDOUT_FILENO)==-1)
+    {
+        fprintf(stderr, "-%s: %s: %s\n", sysname, command->name, strerror(errno));
+        if (fd!=-1) close(fd);
+        if (saved_stdout!=-1) close(saved_stdout);
+        if (cwd_fd!=-1) close(cwd_fd);
+        return NULL;
+    }
+
+    process_command(command);
+    fflush(stdout);
+    if (dup2(saved_stdout, STDOUT_FILENO)==-1)
+        fprintf(stderr, "-%s: %s: %s\n", sysname, command->name, strerror(errno));
+    close(saved_stdout);
+
+    // substitutions do not change the shell's directory, like a subshell
+    if (fchdir(cwd_fd)==-1)
+        fprintf(stderr, "-%s: %s: %s\n", sysname, command->name, strerror(errno));
+    close(cwd_fd);
+
+    if (fstat(fd, &st)==-1 || lseek(fd, 0, SEEK_SET)==-1)
+        fprintf(stderr, "-%s: %s: %s\n", sysname, command->name, strerror(errno));
+    else
+        output=read_fd(fd, st.st_size+FASTIO_CHUNK);
+    close(fd);
+    return output;
+}
+/**
+ * Forks an external command with stdout going into a pipe
+ * @param  command [description]
+ * @return         malloc'd output, NULL if it could not be captured
+ */
+char *capture_external(struct command_t *command)
+{
+    int fds[2];
+    char *output;
+    pid_t pid;
+
+    fflush(stdout);
+    if (pipe(fds)==-1)
+    {
+        fprintf(stderr, "-%s: %s: %s\n", sysname, command->name, strerror(errno));
+        return NULL;
+    }
+    if ((pid=fork())==-1)
+    {
+        fprintf(stderr, "-%s: %s: %s\n", sysname, command->name, strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    if (pid==0) // child
+    {
+        close(fds[0]);
+        if (dup2(fds[1], STDOUT_FILENO)==-1)
+            exit(1);
+        close(fds[1]);
+        exec_command(command);
+    }
+    close(fds[1]);
+    output=read_fd(fds[0], FASTIO_CHUNK);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return output;
+}
+/**
+ * Runs a command line and returns what it wrote to stdout. Builtins run
+ * in this process with stdout pointed at a memfd, external commands are
+ * forked with stdout going into a pipe.
+ * @param  line command line, substitutions in it are run first
+ * @return      malloc'd, null terminated output, empty if it failed
+ */
+char *capture_output(const char *line)
+{
+    char *output;
+    if (line[strspn(line, " \t")]==0) // nothing to run
+        return strdup("");
+
+    struct command_t *command=malloc(sizeof(struct command_t));
+    memset(command, 0, sizeof(struct command_t));
+    parse_command_line(line, command);
+    if (command->name[0]==0)
+    {
+        free_command(command);
+        return strdup("");
+    }
+
+    output=is_builtin(command)?capture_builtin(command):capture_external(command);
+    free_command(command);
+    return output?output:strdup("");
+}
+
+#define SUBST_MARK '\x1a' // stands in for a substitution until the line is parsed
+
+/**
+ * Runs every $(...) and `...` in buf and replaces each one with a marker
+ * holding its index in outputs. The captured text itself never goes
+ * through parse_command, so it cannot add pipes, redirects or quotes.
+ * @param  buf     [description]
+ * @param  outputs set to the malloc'd outputs, trailing newlines dropped
+ * @param  count   set to the number of outputs
+ * @return         malloc'd line with markers
+ */
+char *mark_substitutions(const char *buf, char ***outputs, int *count)
+{
+    size_t size=strlen(buf)+1, len=0;
+    char *out=malloc(size);
+    int i=0, next;
+    *outputs=NULL;
+    *count=0;
+    while (buf[i])
+    {
+        char *inner=NULL;
+        if (buf[i]=='$' && buf[i+1]=='(')
+        {
+            int depth=1, j=i+2;
+            for (;buf[j] && depth>0;++j)
+            {
+                if (buf[j]=='(') depth++;
+                else if (buf[j]==')') depth--;
+            }
+            if (depth==0)
+            {
+                inner=strndup(buf+i+2, j-1-(i+2));
+                next=j;
+            }
+        }
+        else if (buf[i]=='`')
+        {
+            const char *end=strchr(buf+i+1, '`');
+            if (end)
+            {
+                inner=strndup(buf+i+1, end-(buf+i+1));
+                next=end-buf+1;
+            }
+        }
+        if (inner==NULL) // plain character or unterminated substitution
+        {
+            out[len++]=buf[i++];
+            continue;
+        }
+
+        char *result=capture_output(inner);
+        size_t result_len=strlen(result);
+        free(inner);
+        while (result_len>0 && result[result_len-1]=='\n')
+            result[--result_len]=0;
+        *outputs=realloc(*outputs, sizeof(char *)*(*count+1));
+        (*outputs)[*count]=result;
+
+        char marker[32];
+        int marker_len=snprintf(marker, sizeof(marker), "%c%d%c", SUBST_MARK, (*count)++, SUBST_MARK);
+        size=len+marker_len+strlen(buf+next)+1;
+        out=realloc(out, size);
+        memcpy(out+len, marker, marker_len);
+        len+=marker_len;
+        i=next;
+    }
+    out[len]=0;
+    return out;
+}
+/**
+ * Replaces the markers in a word with the outputs they stand for
+ * @return malloc'd string
+ */
+char *substitute_word(const char *word, char **outputs)
+{
+    size_t size=strlen(word)+1, len=0;
+    char *out=malloc(size), *end;
+    const char *p=word;
+    while (*p)
+    {
+        if (*p==SUBST_MARK)
+        {
+            long index=strtol(p+1, &end, 10);
+            if (*end==SUBST_MARK)
+            {
+                size_t n=strlen(outputs[index]);
+                out=realloc(out, size+=n);
+                memcpy(out+len, outputs[index], n);
+                len+=n;
+                p=end+1;
+                continue;
+            }
+        }
+        out[len++]=*p++;
+    }
+    out[len]=0;
+    return out;
+}
+/**
+ * Puts the substitution outputs into a parsed command. A word holding a
+ * substitution is split at whitespace into separate arguments, and when
+ * that word is the name the first piece becomes the new name. Redirect
+ * targets are filled in without splitting.
+ * @param command [description]
+ * @param outputs from mark_substitutions
+ */
+void expand_substitutions(struct command_t *command, char **outputs)
+{
+    char **args=malloc(sizeof(char *)), *word;
+    int count=0;
+    for (int i=-1;i<command->arg_count;++i)
+    {
+        char *arg=i==-1?command->name:command->args[i];
+        if (strchr(arg, SUBST_MARK)==NULL)
+        {
+            args=realloc(args, sizeof(char *)*(count+1));
+            args[count++]=arg;
+            continue;
+        }
+        char *text=substitute_word(arg, outputs);
+        free(arg);
+        for (word=strtok(text, " \t\n");word;word=strtok(NULL, " \t\n"))
+        {
+            args=realloc(args, sizeof(char *)*(count+1));
+            args[count++]=strdup(word);
+        }
+        free(text);
+    }
+    free(command->args);
+
+    if (count==0) // the name expanded to nothing and there are no args
+        command->name=strdup("");
+    else
+    {
+        command->name=args[0];
+        memmove(args, args+1, sizeof(char *)*(count-1));
+    }
+    command->args=args;
+    command->arg_count=count>0?count-1:0;
+
+    for (int i=0;i<3;++i)
+        if (command->redirects[i] && strchr(command->redirects[i], SUBST_MARK))
+        {
+            char *target=substitute_word(command->redirects[i], outputs);
+            free(command->redirects[i]);
+            command->redirects[i]=target;
+        }
+    if (command->next)
+        expand_substitutions(command->next, outputs);
+}
+/**
+ * Parses a command line after running its command substitutions
+ * @param  buf     [description]
+ * @param  command [description]
+ * @return         0
+ */
+int parse_command_line(const char *buf, struct command_t *command)
+{
+    char **outputs;
+    int count;
+    char *marked=mark_substitutions(buf, &outputs, &count);
+    parse_command(marked, command);
+    free(marked);
+    if (count>0)
+        expand_substitutions(command, outputs);
+    for (int i=0;i<count;++i)
+        free(outputs[i]);
+    free(outputs);
+    return 0;
+}
+
 int process_command(struct command_t *command)
 {
     int r;
@@ -405,6 +1274,24 @@ int process_command(struct command_t *command)
             return SUCCESS;
         }
     }
+    if (strcmp(command->name, "fastio")==0)
+    {
+        if (command->arg_count > 0)
+        {
+            if (strcmp(command->args[0], "on")==0)
+                fastio_enabled=true;
+            else if (strcmp(command->args[0], "off")==0)
+                fastio_enabled=false;
+        }
+        printf("fastio: %s\n", fastio_enabled?"on":"off");
+        return SUCCESS;
+    }
+    if (fastio_enabled && !command->background)
+    {
+        r=process_fastio(command);
+        if (r!=UNKNOWN)
+            return r;
+    }
     if (strcmp(command->name, "highlight")==0)   //TODO PUNCTIOATION CASELERE BAK
     {
         if (command->arg_count > 0)
@@ -648,36 +1535,7 @@ int process_command(struct command_t *command)
     pid_t pid=fork();
    // envList = { "HOME=/root", PATH="/bin:/sbin", NULL };
     if (pid==0) // child
-    {
-        /// This shows how to do exec with environ (but is not available on MacOs)
-        // extern char** environ; // environment variables
-        // execvpe(command->name, command->args, environ); // exec+args+path+environ
-
-        /// This shows how to do exec with auto-path resolve
-        // add a NULL argument to the end of args, and the name to the beginning
-        // as required by exec
-        
-        // increase args size by 2
-        command->args=(char **)realloc(
-            command->args, sizeof(char *)*(command->arg_count+=2));
-
-        // shift everything forward by 1
-        for (int i=command->arg_count-2;i>0;--i)
-            command->args[i]=command->args[i-1];
-
-        // set args[0] as a copy of name
-        command->args[0]=strdup(command->name);
-        // set args[arg_count-1] (last) to NULL
-        command->args[command->arg_count-1]=NULL;
-        
-        //char *pathCom= getenv(command->name);
-        //printf("-%s:\n",command->name);
-
-        execvp(command->name, command->args); // exec+args+path
-        exit(0);
-        /// TODO: do your own exec with path resolving using execv()
-        
-    }
+        exec_command(command);
     else
     {
         if (!command->background)